@@ -0,0 +1,321 @@
+#include "routeConformance.h"
+
+#include <cmath>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <stdexcept>
+#include <algorithm>
+#include <functional>
+#include <exception>
+#include <system_error>
+
+namespace
+{
+  const double pi = 3.14159265358979323846;
+  const GPS::metres earth_mean_radius = 6371008.8;
+
+  // Grid cells are never smaller than this, so cell coordinates stay well within range
+  const GPS::metres minimum_cell_size = 0.001;
+
+  // Largest cell coordinate magnitude, leaving room to add ring offsets without overflow
+  const double maximum_cell_coordinate = 4503599627370496.0; // 2^52
+
+  double to_radians(GPS::degrees angle){
+      return angle * pi / 180;
+  }
+}
+
+namespace GPS
+{
+  RouteIndex::RouteIndex(const std::vector<RoutePoint> & routePoints, const ConformanceOptions & options)
+      : options(options)
+  {
+      if (routePoints.empty()) throw std::domain_error("Cannot check conformance against an empty route.");
+      if (! (options.offRouteTolerance > 0) || ! (options.waypointTolerance > 0)) {
+          throw std::domain_error("Conformance tolerances must be positive.");
+      }
+
+      // Centre the projection on the route so the flat-plane distortion stays small
+      degrees latitude_total = 0;
+      for (const RoutePoint & route_point : routePoints) latitude_total += route_point.position.latitude();
+      originLatitude = latitude_total / routePoints.size();
+      originLongitude = routePoints.front().position.longitude();
+      longitudeScale = std::cos(to_radians(originLatitude));
+
+      // The waypoint search then only needs to look at the neighbouring cells
+      waypointCellSize = std::max(options.waypointTolerance, minimum_cell_size);
+      for (std::size_t waypoint_index = 0; waypoint_index < routePoints.size(); waypoint_index++) {
+          const Point waypoint = project(routePoints[waypoint_index].position);
+          waypoints.push_back(waypoint);
+          waypointCells[cell_key(cell_coordinate(waypoint.x, waypointCellSize), cell_coordinate(waypoint.y, waypointCellSize))].push_back(waypoint_index);
+      }
+
+      // A single-point route is treated as one zero-length segment
+      const std::size_t segment_count = std::max<std::size_t>(waypoints.size() - 1, 1);
+      metres total_length = 0;
+      for (std::size_t segment_index = 0; segment_index < segment_count; segment_index++) {
+          const Point start = waypoints[segment_index];
+          const Point end = waypoints[std::min(segment_index + 1, waypoints.size() - 1)];
+          const Point direction = {end.x - start.x, end.y - start.y};
+          const metres length_squared = direction.x * direction.x + direction.y * direction.y;
+          segments.push_back({start, direction, length_squared});
+          total_length += std::sqrt(length_squared);
+      }
+
+      // Sizing cells by the average segment length keeps the total number of samples in insert_segment linear in the segment count
+      segmentCellSize = std::max(total_length > 0 ? total_length / segment_count : options.offRouteTolerance, minimum_cell_size);
+      minColumn = minRow = std::numeric_limits<long long>::max();
+      maxColumn = maxRow = std::numeric_limits<long long>::min();
+      for (std::size_t segment_index = 0; segment_index < segment_count; segment_index++) insert_segment(segment_index);
+  }
+
+  // Equirectangular projection into metres relative to the route's origin
+  RouteIndex::Point RouteIndex::project(const Position & position) const {
+      degrees longitude_difference = position.longitude() - originLongitude;
+      if (longitude_difference > 180) longitude_difference -= 360;
+      if (longitude_difference < -180) longitude_difference += 360;
+      const metres x = earth_mean_radius * to_radians(longitude_difference) * longitudeScale;
+      const metres y = earth_mean_radius * to_radians(position.latitude() - originLatitude);
+      return {x, y};
+  }
+
+  RouteIndex::CellKey RouteIndex::cell_key(long long column, long long row) const {
+      // Built in unsigned arithmetic, as left-shifting a negative column is undefined
+      return static_cast<CellKey>((static_cast<unsigned long long>(column) << 32) ^ (static_cast<unsigned long long>(row) & 0xFFFFFFFFULL));
+  }
+
+  long long RouteIndex::cell_coordinate(metres value, metres cell_size) const {
+      // Clamped so that a far-away or non-finite point cannot overflow the cast
+      const double coordinate = std::floor(value / cell_size);
+      if (! (coordinate > -maximum_cell_coordinate)) return static_cast<long long>(-maximum_cell_coordinate);
+      if (! (coordinate < maximum_cell_coordinate)) return static_cast<long long>(maximum_cell_coordinate);
+      return static_cast<long long>(coordinate);
+  }
+
+  /*  Registers the segment in every cell it is sampled in.
+   *  Sampling every half cell can miss a cell whose corner the segment only clips, but such a
+   *  cell is always next to one that was registered; cross_track_distance allows for this.
+   */
+  void RouteIndex::insert_segment(std::size_t segment_index){
+      const Segment & segment = segments[segment_index];
+      const metres length = std::sqrt(segment.lengthSquared);
+      const std::size_t sample_count = static_cast<std::size_t>(std::ceil(length / (segmentCellSize / 2))) + 1;
+      CellKey previous_key = 0;
+      for (std::size_t sample = 0; sample < sample_count; sample++) {
+          const double fraction = sample_count == 1 ? 0 : static_cast<double>(sample) / (sample_count - 1);
+          const metres x = segment.start.x + fraction * segment.direction.x;
+          const metres y = segment.start.y + fraction * segment.direction.y;
+          const long long column = cell_coordinate(x, segmentCellSize);
+          const long long row = cell_coordinate(y, segmentCellSize);
+          const CellKey key = cell_key(column, row);
+          if (sample > 0 && key == previous_key) continue;
+          minColumn = std::min(minColumn, column);
+          maxColumn = std::max(maxColumn, column);
+          minRow = std::min(minRow, row);
+          maxRow = std::max(maxRow, row);
+          std::vector<std::size_t> & cell = segmentCells[key];
+          if (cell.empty() || cell.back() != segment_index) cell.push_back(segment_index);
+          previous_key = key;
+      }
+  }
+
+  /*  Distance from the point to the nearest route segment.
+   *  Searches rings of cells outwards from the point's cell. After ring r, any segment not yet seen
+   *  passes no closer than ring r (see insert_segment), so is at least (r - 1) cells away.
+   *  Rings that lie entirely outside the occupied cells are skipped, the search stops once the
+   *  rings surround every occupied cell, and it falls back to checking every segment once it would
+   *  visit more cells than there are segments.
+   */
+  metres RouteIndex::cross_track_distance(Point point) const {
+      auto distance_to_segment = [&point](const Segment & segment){
+          double fraction = 0;
+          if (segment.lengthSquared > 0) {
+              fraction = ((point.x - segment.start.x) * segment.direction.x + (point.y - segment.start.y) * segment.direction.y) / segment.lengthSquared;
+              fraction = std::min(1.0, std::max(0.0, fraction));
+          }
+          return std::hypot(point.x - (segment.start.x + fraction * segment.direction.x),
+                            point.y - (segment.start.y + fraction * segment.direction.y));
+      };
+
+      const long long column = cell_coordinate(point.x, segmentCellSize);
+      const long long row = cell_coordinate(point.y, segmentCellSize);
+      metres nearest = std::numeric_limits<metres>::infinity();
+      std::size_t cells_visited = 0;
+
+      auto check_cell = [&](long long cell_column, long long cell_row){
+          cells_visited++;
+          auto cell = segmentCells.find(cell_key(cell_column, cell_row));
+          if (cell == segmentCells.end()) return;
+          for (std::size_t segment_index : cell->second) nearest = std::min(nearest, distance_to_segment(segments[segment_index]));
+      };
+
+      // Rings nearer than the occupied cells are empty
+      const long long column_gap = std::max({minColumn - column, column - maxColumn, 0LL});
+      const long long row_gap = std::max({minRow - row, row - maxRow, 0LL});
+      const long long first_ring = std::max(column_gap, row_gap);
+
+      for (long long ring = first_ring; ; ring++) {
+          const std::size_t ring_cells = ring == 0 ? 1 : static_cast<std::size_t>(8 * ring);
+          if (cells_visited + ring_cells > segments.size()) { // Fall back to a linear scan
+              for (const Segment & segment : segments) nearest = std::min(nearest, distance_to_segment(segment));
+              return nearest;
+          }
+          if (ring == 0) check_cell(column, row);
+          for (long long offset = -ring; offset <= ring && ring > 0; offset++) {
+              check_cell(column + offset, row - ring);
+              check_cell(column + offset, row + ring);
+              if (offset != -ring && offset != ring) {
+                  check_cell(column - ring, row + offset);
+                  check_cell(column + ring, row + offset);
+              }
+          }
+          if (nearest <= (ring - 1) * segmentCellSize) return nearest;
+          // Every segment is registered in an occupied cell, so once they are all covered none are left
+          if (column - ring <= minColumn && column + ring >= maxColumn && row - ring <= minRow && row + ring >= maxRow) return nearest;
+      }
+  }
+
+  // Marks every waypoint within the waypoint tolerance of the point as visited
+  void RouteIndex::mark_waypoints_near(Point point, std::vector<bool> & visited) const {
+      const long long column = cell_coordinate(point.x, waypointCellSize);
+      const long long row = cell_coordinate(point.y, waypointCellSize);
+      for (long long cell_column = column - 1; cell_column <= column + 1; cell_column++) {
+          for (long long cell_row = row - 1; cell_row <= row + 1; cell_row++) {
+              auto cell = waypointCells.find(cell_key(cell_column, cell_row));
+              if (cell == waypointCells.end()) continue;
+              for (std::size_t waypoint_index : cell->second) {
+                  const Point & waypoint = waypoints[waypoint_index];
+                  if (std::hypot(point.x - waypoint.x, point.y - waypoint.y) <= options.waypointTolerance) visited[waypoint_index] = true;
+              }
+          }
+      }
+  }
+
+  ConformanceReport RouteIndex::check(const std::vector<TrackPoint> & trackPoints) const {
+      ConformanceReport report;
+      std::vector<bool> visited(waypoints.size(), false);
+      metres total_distance = 0;
+      bool off_route = false;
+
+      for (std::size_t track_point_index = 0; track_point_index < trackPoints.size(); track_point_index++) {
+          const TrackPoint & track_point = trackPoints[track_point_index];
+          const Point point = project(track_point.position);
+          const metres distance = cross_track_distance(point);
+          total_distance += distance;
+          report.maxCrossTrackDistance = std::max(report.maxCrossTrackDistance, distance);
+          mark_waypoints_near(point, visited);
+
+          // Extend the current off-route interval, or start a new one
+          if (distance > options.offRouteTolerance) {
+              if (off_route) {
+                  report.offRouteIntervals.back().lastTrackPointIndex = track_point_index;
+                  report.offRouteIntervals.back().endTime = track_point.dateTime;
+              }
+              else {
+                  report.offRouteIntervals.push_back({track_point_index, track_point_index, track_point.dateTime, track_point.dateTime});
+              }
+          }
+          off_route = distance > options.offRouteTolerance;
+      }
+
+      if (! trackPoints.empty()) report.meanCrossTrackDistance = total_distance / trackPoints.size();
+      for (std::size_t waypoint_index = 0; waypoint_index < visited.size(); waypoint_index++) {
+          if (! visited[waypoint_index]) report.missedWaypoints.push_back(waypoint_index);
+      }
+      return report;
+  }
+
+  /*  Each worker takes from the back of its own deque and steals from the front of the others,
+   *  so uneven track lengths don't leave threads idle. No tasks are added once started, so a
+   *  worker can stop as soon as every deque is empty.
+   */
+  void runWorkStealing(std::size_t task_count, unsigned int thread_count, const std::function<void(std::size_t)> & task)
+  {
+      if (thread_count == 0) thread_count = std::max(1u, std::thread::hardware_concurrency());
+      thread_count = static_cast<unsigned int>(std::min<std::size_t>(thread_count, task_count));
+      std::mutex error_lock;
+      std::exception_ptr first_error;
+      auto run_task = [&](std::size_t task_index){
+          try {
+              task(task_index);
+          }
+          catch (...) {
+              std::lock_guard<std::mutex> guard(error_lock);
+              if (! first_error) first_error = std::current_exception();
+          }
+      };
+
+      if (thread_count <= 1) { // Not worth starting any threads
+          for (std::size_t task_index = 0; task_index < task_count; task_index++) run_task(task_index);
+          if (first_error) std::rethrow_exception(first_error);
+          return;
+      }
+
+      struct WorkQueue
+      {
+          std::mutex lock;
+          std::deque<std::size_t> tasks;
+      };
+      std::vector<WorkQueue> queues(thread_count);
+      for (unsigned int worker = 0; worker < thread_count; worker++) {
+          const std::size_t first_task = task_count * worker / thread_count;
+          const std::size_t end_task = task_count * (worker + 1) / thread_count;
+          for (std::size_t task_index = first_task; task_index < end_task; task_index++) queues[worker].tasks.push_back(task_index);
+      }
+
+      auto take_task = [&queues, thread_count](unsigned int worker, std::size_t & task_index){
+          {
+              std::lock_guard<std::mutex> guard(queues[worker].lock);
+              if (! queues[worker].tasks.empty()) {
+                  task_index = queues[worker].tasks.back();
+                  queues[worker].tasks.pop_back();
+                  return true;
+              }
+          }
+          for (unsigned int offset = 1; offset < thread_count; offset++) { // Try to steal from the other workers
+              WorkQueue & victim = queues[(worker + offset) % thread_count];
+              std::lock_guard<std::mutex> guard(victim.lock);
+              if (! victim.tasks.empty()) {
+                  task_index = victim.tasks.front();
+                  victim.tasks.pop_front();
+                  return true;
+              }
+          }
+          return false;
+      };
+
+      auto work = [&](unsigned int worker){
+          std::size_t task_index;
+          while (take_task(worker, task_index)) run_task(task_index);
+      };
+
+      // Reserve up front so nothing can allocate, and throw, once threads are running
+      std::vector<std::thread> workers;
+      workers.reserve(thread_count - 1);
+      try {
+          for (unsigned int worker = 1; worker < thread_count; worker++) workers.emplace_back(work, worker);
+      }
+      catch (const std::system_error &) {
+          // The queues of workers that never started are stolen by the ones that did, including this thread
+      }
+      work(0); // The calling thread does its share too
+      for (std::thread & worker : workers) worker.join();
+
+      if (first_error) std::rethrow_exception(first_error);
+  }
+
+  std::vector<ConformanceReport> checkConformance(const std::vector<RoutePoint> & routePoints,
+                                                  const std::vector<std::vector<TrackPoint>> & tracks,
+                                                  const ConformanceOptions & options)
+  {
+      const RouteIndex route_index(routePoints, options);
+      std::vector<ConformanceReport> reports(tracks.size());
+      // Each task writes only to its own report, so no locking is needed
+      runWorkStealing(tracks.size(), options.threads, [&](std::size_t track_index){
+          reports[track_index] = route_index.check(tracks[track_index]);
+      });
+      return reports;
+  }
+}
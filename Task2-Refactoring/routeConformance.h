@@ -0,0 +1,120 @@
+#ifndef ROUTECONFORMANCE_H_261018
+#define ROUTECONFORMANCE_H_261018
+
+#include <ctime>
+#include <string>
+#include <vector>
+#include <functional>
+#include <unordered_map>
+
+#include "types.h"
+#include "points.h"
+
+namespace GPS
+{
+  // Tolerances and scheduling settings used when checking tracks against a route
+  struct ConformanceOptions
+  {
+      // A track point further than this from every route segment is off-route
+      metres offRouteTolerance = 50;
+
+      // A waypoint is missed if no track point comes within this distance of it
+      metres waypointTolerance = 50;
+
+      // Number of worker threads; 0 means use std::thread::hardware_concurrency()
+      unsigned int threads = 0;
+  };
+
+  // A contiguous run of track points that are all further than the tolerance from the route
+  struct OffRouteInterval
+  {
+      std::size_t firstTrackPointIndex;
+      std::size_t lastTrackPointIndex;
+      std::tm startTime;
+      std::tm endTime;
+  };
+
+  // The result of checking one track against a route
+  struct ConformanceReport
+  {
+      metres maxCrossTrackDistance = 0;
+      metres meanCrossTrackDistance = 0;
+
+      // Indices into the route points of every waypoint the track did not pass
+      std::vector<std::size_t> missedWaypoints;
+
+      std::vector<OffRouteInterval> offRouteIntervals;
+  };
+
+  /*  A precomputed spatial index over the segments and waypoints of a route.
+   *  The route is projected onto a local flat plane (equirectangular, centred on the route's
+   *  mean latitude and first longitude) and its segments are bucketed into a uniform grid, so
+   *  finding the nearest segment to a track point only visits the cells around it rather than
+   *  every segment.
+   *
+   *  The segment grid's cell size is the average segment length (or the off-route tolerance if
+   *  every segment has zero length), so building it takes O(number of segments) cell insertions
+   *  whatever the tolerances are. A nearest-segment search visits at most as many cells as there
+   *  are segments before falling back to checking every segment, and stops once it has covered
+   *  the whole route, so a point far from the route costs no more than a linear scan.
+   *
+   *  Waypoints are kept in a separate grid whose cell size is the waypoint tolerance, so marking
+   *  the waypoints near a track point only looks at the 3x3 cells around it.
+   *  Neither grid uses cells smaller than 1mm.
+   *
+   *  The index is read-only after construction, so one instance can be shared by many threads.
+   *  Throws a std::domain_error if the route is empty or a tolerance is not positive.
+   */
+  class RouteIndex
+  {
+    public:
+      RouteIndex(const std::vector<RoutePoint> & routePoints, const ConformanceOptions & options = {});
+
+      ConformanceReport check(const std::vector<TrackPoint> & trackPoints) const;
+
+    private:
+      struct Point { metres x; metres y; };
+      struct Segment { Point start; Point direction; metres lengthSquared; };
+      using CellKey = long long;
+
+      Point project(const Position & position) const;
+      CellKey cell_key(long long column, long long row) const;
+      long long cell_coordinate(metres value, metres cell_size) const;
+      void insert_segment(std::size_t segment_index);
+      metres cross_track_distance(Point point) const;
+      void mark_waypoints_near(Point point, std::vector<bool> & visited) const;
+
+      ConformanceOptions options;
+      degrees originLatitude;
+      degrees originLongitude;
+      double longitudeScale;
+      metres segmentCellSize;
+      metres waypointCellSize;
+
+      // The range of segment grid cells that contain any segment
+      long long minColumn, maxColumn, minRow, maxRow;
+
+      std::vector<Point> waypoints;
+      std::vector<Segment> segments;
+      std::unordered_map<CellKey, std::vector<std::size_t>> segmentCells;
+      std::unordered_map<CellKey, std::vector<std::size_t>> waypointCells;
+  };
+
+  /*  Runs task(0) ... task(taskCount - 1) over a work-stealing pool of threads.
+   *  Each worker starts with its own contiguous block of tasks and steals from the others once it
+   *  runs out. A threads value of 0 means std::thread::hardware_concurrency(); no more threads
+   *  than tasks are used. If any task throws, the remaining tasks still run and the first
+   *  exception is rethrown to the caller.
+   */
+  void runWorkStealing(std::size_t taskCount, unsigned int threads, const std::function<void(std::size_t)> & task);
+
+  /*  Check every track against the same route.
+   *  The route is indexed once, then the tracks are scheduled over a work-stealing pool of threads.
+   *  The reports are returned in the same order as the tracks.
+   */
+  std::vector<ConformanceReport> checkConformance(const std::vector<RoutePoint> & routePoints,
+                                                  const std::vector<std::vector<TrackPoint>> & tracks,
+                                                  const ConformanceOptions & options = {});
+}
+
+#endif
@@ -12,6 +12,7 @@ HEADERS += \
     headers/points.h \
     headers/position.h \
     headers/route.h \
+    headers/routeConformance.h \
     headers/track.h \
     headers/types.h \
     headers/gridworld/gridworld_model.h \
@@ -26,6 +27,7 @@ SOURCES += \
     src/logs.cpp \
     src/position.cpp \
     src/route.cpp \
+    src/routeConformance.cpp \
     src/track.cpp \
     src/gridworld/gridworld_model.cpp \
     src/gridworld/gridworld_route.cpp \
@@ -37,7 +39,8 @@ SOURCES += \
     tests/route/route-tests.cpp \
     tests/route/numpoints.cpp \
     tests/route/indexing.cpp \
-    tests/route/maxSpeed.cpp
+    tests/route/maxSpeed.cpp \
+    tests/route/routeConformance.cpp
 
 INCLUDEPATH += headers/ headers/xml/ headers/gridworld
 
@@ -45,4 +48,4 @@ OBJECTS_DIR = $$_PRO_FILE_PWD_/bin/
 DESTDIR = $$_PRO_FILE_PWD_/bin/
 TARGET = route-tests
 
-LIBS += -lboost_unit_test_framework
+LIBS += -lboost_unit_test_framework -pthread
@@ -0,0 +1,372 @@
+#include <boost/test/unit_test.hpp>
+
+#include <cmath>
+#include <random>
+#include <limits>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <stdexcept>
+
+#include "routeConformance.h"
+
+using namespace GPS;
+
+///////////////////////////////////////////////////////////////////////////////
+
+BOOST_AUTO_TEST_SUITE( route_conformance )
+
+const double percentageTolerance = 0.0001;
+
+// Must match the radius used by RouteIndex's projection
+const metres earthMeanRadius = 6371008.8;
+const double pi = 3.14159265358979323846;
+
+// Metres per degree of latitude, i.e. along a meridian in the projection
+const metres metresPerDegree = earthMeanRadius * pi / 180;
+
+// Three waypoints along the equator, 0.01 degrees (about 1.1 km) apart
+const std::vector<RoutePoint> equatorRoute = { { Position(0, 0),    "R0" },
+                                               { Position(0, 0.01), "R1" },
+                                               { Position(0, 0.02), "R2" }
+                                             };
+
+std::tm timeAt(int hour, int minute)
+{
+    std::tm date_time = {};
+    date_time.tm_hour = hour;
+    date_time.tm_min = minute;
+    return date_time;
+}
+
+// A track point every 0.001 degrees along the equator route, offset north by the given number of degrees
+std::vector<TrackPoint> trackAlongEquator(degrees latitudeOffset)
+{
+    std::vector<TrackPoint> trackPoints;
+    for (int step = 0; step <= 20; step++) {
+        trackPoints.push_back({ Position(latitudeOffset, step * 0.001), "T" + std::to_string(step), timeAt(0, step) });
+    }
+    return trackPoints;
+}
+
+// The same equirectangular projection as RouteIndex, so the brute-force scan sees the same plane
+struct PlanePoint { metres x; metres y; };
+
+std::vector<PlanePoint> project(const std::vector<Position> & positions, degrees originLatitude, degrees originLongitude)
+{
+    std::vector<PlanePoint> projected;
+    for (const Position & position : positions) {
+        const metres x = metresPerDegree * (position.longitude() - originLongitude) * std::cos(originLatitude * pi / 180);
+        const metres y = metresPerDegree * (position.latitude() - originLatitude);
+        projected.push_back({x, y});
+    }
+    return projected;
+}
+
+metres bruteForceCrossTrackDistance(const PlanePoint & point, const std::vector<PlanePoint> & route)
+{
+    metres nearest = std::numeric_limits<metres>::infinity();
+    for (std::size_t index = 0; index + 1 < route.size(); index++) {
+        const metres dx = route[index + 1].x - route[index].x;
+        const metres dy = route[index + 1].y - route[index].y;
+        const metres lengthSquared = dx * dx + dy * dy;
+        double fraction = lengthSquared > 0 ? ((point.x - route[index].x) * dx + (point.y - route[index].y) * dy) / lengthSquared : 0;
+        fraction = std::min(1.0, std::max(0.0, fraction));
+        nearest = std::min(nearest, std::hypot(point.x - (route[index].x + fraction * dx), point.y - (route[index].y + fraction * dy)));
+    }
+    return nearest;
+}
+
+
+// Typical input - A track that follows the route exactly is never off it
+BOOST_AUTO_TEST_CASE( track_on_route )
+{
+    const RouteIndex routeIndex {equatorRoute};
+    const ConformanceReport report = routeIndex.check(trackAlongEquator(0));
+
+    BOOST_CHECK_SMALL(report.maxCrossTrackDistance, 1e-6);
+    BOOST_CHECK_SMALL(report.meanCrossTrackDistance, 1e-6);
+    BOOST_CHECK(report.missedWaypoints.empty());
+    BOOST_CHECK(report.offRouteIntervals.empty());
+}
+
+// Typical input - A track running parallel to the route is off it by the offset everywhere
+BOOST_AUTO_TEST_CASE( track_offset_from_route )
+{
+    const RouteIndex routeIndex {equatorRoute};
+    const ConformanceReport report = routeIndex.check(trackAlongEquator(0.001));
+    const metres expectedDistance = 0.001 * metresPerDegree;
+
+    BOOST_CHECK_CLOSE(report.maxCrossTrackDistance, expectedDistance, percentageTolerance);
+    BOOST_CHECK_CLOSE(report.meanCrossTrackDistance, expectedDistance, percentageTolerance);
+    BOOST_REQUIRE_EQUAL(report.offRouteIntervals.size(), 1u);
+    BOOST_CHECK_EQUAL(report.offRouteIntervals[0].firstTrackPointIndex, 0u);
+    BOOST_CHECK_EQUAL(report.offRouteIntervals[0].lastTrackPointIndex, 20u);
+}
+
+// Typical input - The mean is taken over every track point, not just the off-route ones
+BOOST_AUTO_TEST_CASE( mean_over_all_points )
+{
+    const RouteIndex routeIndex {equatorRoute};
+    const std::vector<TrackPoint> trackPoints = { { Position(0, 0.005),     "T0", timeAt(0, 0) },
+                                                  { Position(0.002, 0.010), "T1", timeAt(0, 1) },
+                                                  { Position(0, 0.015),     "T2", timeAt(0, 2) }
+                                                };
+    const ConformanceReport report = routeIndex.check(trackPoints);
+
+    BOOST_CHECK_CLOSE(report.maxCrossTrackDistance, 0.002 * metresPerDegree, percentageTolerance);
+    BOOST_CHECK_CLOSE(report.meanCrossTrackDistance, 0.002 * metresPerDegree / 3, percentageTolerance);
+}
+
+// Typical input - A track that stops half way misses the last waypoint only
+BOOST_AUTO_TEST_CASE( missed_waypoints )
+{
+    const RouteIndex routeIndex {equatorRoute};
+    std::vector<TrackPoint> trackPoints = trackAlongEquator(0);
+    trackPoints.erase(trackPoints.begin() + 11, trackPoints.end()); // Stop at R1
+
+    const ConformanceReport report = routeIndex.check(trackPoints);
+    const std::vector<std::size_t> expectedMissed = {2};
+    BOOST_CHECK_EQUAL_COLLECTIONS(report.missedWaypoints.begin(), report.missedWaypoints.end(),
+                                  expectedMissed.begin(), expectedMissed.end());
+}
+
+// Typical input - A track that passes near but outside the waypoint tolerance still misses it
+BOOST_AUTO_TEST_CASE( waypoint_just_outside_tolerance )
+{
+    ConformanceOptions options;
+    options.offRouteTolerance = 1000;
+    options.waypointTolerance = 100;
+    const RouteIndex routeIndex {equatorRoute, options};
+
+    // About 111m north of the route
+    const ConformanceReport report = routeIndex.check(trackAlongEquator(0.001));
+    BOOST_CHECK_EQUAL(report.missedWaypoints.size(), 3u);
+    BOOST_CHECK(report.offRouteIntervals.empty());
+}
+
+// Typical input - Off-route intervals cover exactly the points beyond the tolerance, with their times
+BOOST_AUTO_TEST_CASE( off_route_interval_bounds )
+{
+    const RouteIndex routeIndex {equatorRoute};
+    std::vector<TrackPoint> trackPoints = trackAlongEquator(0);
+    for (std::size_t index = 5; index <= 8; index++) {
+        trackPoints[index].position = Position(0.001, trackPoints[index].position.longitude());
+    }
+    trackPoints[15].position = Position(-0.001, trackPoints[15].position.longitude());
+
+    const ConformanceReport report = routeIndex.check(trackPoints);
+    BOOST_REQUIRE_EQUAL(report.offRouteIntervals.size(), 2u);
+
+    BOOST_CHECK_EQUAL(report.offRouteIntervals[0].firstTrackPointIndex, 5u);
+    BOOST_CHECK_EQUAL(report.offRouteIntervals[0].lastTrackPointIndex, 8u);
+    BOOST_CHECK_EQUAL(report.offRouteIntervals[0].startTime.tm_min, 5);
+    BOOST_CHECK_EQUAL(report.offRouteIntervals[0].endTime.tm_min, 8);
+
+    BOOST_CHECK_EQUAL(report.offRouteIntervals[1].firstTrackPointIndex, 15u);
+    BOOST_CHECK_EQUAL(report.offRouteIntervals[1].lastTrackPointIndex, 15u);
+    BOOST_CHECK_EQUAL(report.offRouteIntervals[1].startTime.tm_min, 15);
+    BOOST_CHECK_EQUAL(report.offRouteIntervals[1].endTime.tm_min, 15);
+}
+
+// Edge case - An empty track has no distances and misses every waypoint
+BOOST_AUTO_TEST_CASE( empty_track )
+{
+    const RouteIndex routeIndex {equatorRoute};
+    const ConformanceReport report = routeIndex.check({});
+
+    BOOST_CHECK_EQUAL(report.maxCrossTrackDistance, 0);
+    BOOST_CHECK_EQUAL(report.meanCrossTrackDistance, 0);
+    BOOST_CHECK_EQUAL(report.missedWaypoints.size(), 3u);
+    BOOST_CHECK(report.offRouteIntervals.empty());
+}
+
+// Boundary case - A single-point route measures distance to that point
+BOOST_AUTO_TEST_CASE( single_point_route )
+{
+    const std::vector<RoutePoint> routePoints = { { Position(0, 0), "R0" } };
+    const RouteIndex routeIndex {routePoints};
+    const std::vector<TrackPoint> trackPoints = { { Position(0, 0),     "T0", timeAt(0, 0) },
+                                                  { Position(0.003, 0), "T1", timeAt(0, 1) }
+                                                };
+    const ConformanceReport report = routeIndex.check(trackPoints);
+
+    BOOST_CHECK_CLOSE(report.maxCrossTrackDistance, 0.003 * metresPerDegree, percentageTolerance);
+    BOOST_CHECK(report.missedWaypoints.empty());
+    BOOST_REQUIRE_EQUAL(report.offRouteIntervals.size(), 1u);
+    BOOST_CHECK_EQUAL(report.offRouteIntervals[0].firstTrackPointIndex, 1u);
+}
+
+// Error case - An empty route cannot be indexed
+BOOST_AUTO_TEST_CASE( empty_route )
+{
+    BOOST_REQUIRE_THROW(RouteIndex(std::vector<RoutePoint>{}), std::domain_error);
+    try
+    {
+        RouteIndex(std::vector<RoutePoint>{});
+    }
+    catch (const std::domain_error & e)
+    {
+        BOOST_CHECK_EQUAL( e.what() , "Cannot check conformance against an empty route.");
+    }
+}
+
+// Error case - Tolerances must be strictly positive
+BOOST_AUTO_TEST_CASE( non_positive_tolerance )
+{
+    ConformanceOptions zeroOffRoute;
+    zeroOffRoute.offRouteTolerance = 0;
+    ConformanceOptions negativeWaypoint;
+    negativeWaypoint.waypointTolerance = -1;
+
+    BOOST_CHECK_THROW(RouteIndex(equatorRoute, zeroOffRoute), std::domain_error);
+    BOOST_REQUIRE_THROW(RouteIndex(equatorRoute, negativeWaypoint), std::domain_error);
+    try
+    {
+        RouteIndex(equatorRoute, negativeWaypoint);
+    }
+    catch (const std::domain_error & e)
+    {
+        BOOST_CHECK_EQUAL( e.what() , "Conformance tolerances must be positive.");
+    }
+}
+
+// Typical input - Reports come back in the same order as the tracks when run over several threads
+BOOST_AUTO_TEST_CASE( batch_keeps_track_order )
+{
+    std::vector<std::vector<TrackPoint>> tracks;
+    for (int trackNum = 0; trackNum < 50; trackNum++) tracks.push_back(trackAlongEquator(trackNum * 0.0001));
+
+    ConformanceOptions options;
+    options.threads = 4;
+    const std::vector<ConformanceReport> reports = checkConformance(equatorRoute, tracks, options);
+
+    BOOST_REQUIRE_EQUAL(reports.size(), tracks.size());
+    for (std::size_t trackNum = 0; trackNum < tracks.size(); trackNum++) {
+        BOOST_CHECK_CLOSE(reports[trackNum].maxCrossTrackDistance + 1, trackNum * 0.0001 * metresPerDegree + 1, percentageTolerance);
+    }
+}
+
+// Boundary case - Zero threads means one per core, and asking for more threads than tracks is clamped
+BOOST_AUTO_TEST_CASE( batch_default_and_excess_threads )
+{
+    const std::vector<std::vector<TrackPoint>> tracks = { trackAlongEquator(0), trackAlongEquator(0.001), trackAlongEquator(0.002) };
+
+    ConformanceOptions serial;
+    serial.threads = 1;
+    ConformanceOptions hardwareThreads;
+    hardwareThreads.threads = 0;
+    ConformanceOptions excessThreads;
+    excessThreads.threads = 64;
+
+    const std::vector<ConformanceReport> expected = checkConformance(equatorRoute, tracks, serial);
+    for (const ConformanceOptions & options : { hardwareThreads, excessThreads }) {
+        const std::vector<ConformanceReport> reports = checkConformance(equatorRoute, tracks, options);
+        BOOST_REQUIRE_EQUAL(reports.size(), tracks.size());
+        for (std::size_t trackNum = 0; trackNum < tracks.size(); trackNum++) {
+            BOOST_CHECK_EQUAL(reports[trackNum].maxCrossTrackDistance, expected[trackNum].maxCrossTrackDistance);
+            BOOST_CHECK_EQUAL(reports[trackNum].offRouteIntervals.size(), expected[trackNum].offRouteIntervals.size());
+        }
+    }
+}
+
+// Typical input - With uneven task costs every task still runs exactly once
+BOOST_AUTO_TEST_CASE( work_stealing_runs_every_task_once )
+{
+    const std::size_t taskCount = 40;
+    std::vector<std::atomic<int>> runCounts(taskCount);
+    for (std::atomic<int> & runCount : runCounts) runCount = 0;
+
+    // The first worker's block is much slower, so the others have to steal from it
+    runWorkStealing(taskCount, 4, [&runCounts](std::size_t taskIndex){
+        if (taskIndex < 10) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        runCounts[taskIndex]++;
+    });
+
+    for (std::size_t taskIndex = 0; taskIndex < taskCount; taskIndex++) BOOST_CHECK_EQUAL(runCounts[taskIndex], 1);
+}
+
+// Error case - An exception thrown by one task reaches the caller after the other tasks have run
+BOOST_AUTO_TEST_CASE( work_stealing_rethrows_task_exception )
+{
+    std::atomic<int> tasksRun {0};
+    auto task = [&tasksRun](std::size_t taskIndex){
+        if (taskIndex == 37) throw std::runtime_error("Task 37 failed.");
+        tasksRun++;
+    };
+
+    BOOST_REQUIRE_THROW(runWorkStealing(100, 4, task), std::runtime_error);
+    BOOST_CHECK_EQUAL(tasksRun, 99);
+    try
+    {
+        runWorkStealing(100, 4, task);
+    }
+    catch (const std::runtime_error & e)
+    {
+        BOOST_CHECK_EQUAL( e.what() , "Task 37 failed.");
+    }
+}
+
+// Edge case - A tiny waypoint tolerance and a near-degenerate route still index a point on the other side of the world
+BOOST_AUTO_TEST_CASE( tiny_cells_far_point )
+{
+    const std::vector<TrackPoint> farTrack = { { Position(60, 150), "T0", timeAt(0, 0) } };
+    const metres expectedDistance = std::hypot(150 * metresPerDegree, 60 * metresPerDegree);
+
+    ConformanceOptions tinyWaypointTolerance;
+    tinyWaypointTolerance.waypointTolerance = 1e-13;
+    const std::vector<RoutePoint> twoPointRoute = { { Position(0, 0), "R0" }, { Position(0, 0.01), "R1" } };
+    const ConformanceReport tinyToleranceReport = RouteIndex(twoPointRoute, tinyWaypointTolerance).check(farTrack);
+    BOOST_CHECK_EQUAL(tinyToleranceReport.missedWaypoints.size(), 2u);
+    BOOST_CHECK_EQUAL(tinyToleranceReport.offRouteIntervals.size(), 1u);
+
+    const std::vector<RoutePoint> degenerateRoute = { { Position(0, 0), "R0" }, { Position(0, 1e-22), "R1" } };
+    const ConformanceReport degenerateReport = RouteIndex(degenerateRoute).check(farTrack);
+    BOOST_CHECK_CLOSE(degenerateReport.maxCrossTrackDistance, expectedDistance, percentageTolerance);
+    BOOST_CHECK_EQUAL(degenerateReport.missedWaypoints.size(), 2u);
+}
+
+// Typical input - The grid search finds the same nearest segment as checking every segment
+BOOST_AUTO_TEST_CASE( grid_matches_brute_force )
+{
+    std::mt19937 generator(2021);
+    std::uniform_real_distribution<double> step(-0.01, 0.01);
+    std::uniform_real_distribution<double> scatter(-0.3, 0.3);
+
+    // A wandering route of 300 points, around 50 km across
+    std::vector<RoutePoint> routePoints;
+    std::vector<Position> routePositions;
+    degrees latitude = 52.9, longitude = -1.2;
+    for (int pointNum = 0; pointNum < 300; pointNum++) {
+        latitude += step(generator);
+        longitude += step(generator);
+        routePoints.push_back({ Position(latitude, longitude), "" });
+        routePositions.push_back(Position(latitude, longitude));
+    }
+
+    // Random points on, near and far from the route
+    std::vector<Position> trackPositions;
+    for (int pointNum = 0; pointNum < 2000; pointNum++) {
+        const Position & near = routePositions[pointNum % routePositions.size()];
+        const double spread = (pointNum % 3 == 0) ? 0.001 : (pointNum % 3 == 1) ? 0.05 : 1.0;
+        trackPositions.push_back(Position(near.latitude() + scatter(generator) * spread,
+                                          near.longitude() + scatter(generator) * spread));
+    }
+
+    degrees latitudeTotal = 0;
+    for (const Position & position : routePositions) latitudeTotal += position.latitude();
+    const std::vector<PlanePoint> plane = project(routePositions, latitudeTotal / routePositions.size(), routePositions.front().longitude());
+    const std::vector<PlanePoint> planeTrack = project(trackPositions, latitudeTotal / routePositions.size(), routePositions.front().longitude());
+
+    const RouteIndex routeIndex {routePoints};
+    for (std::size_t pointNum = 0; pointNum < trackPositions.size(); pointNum++) {
+        const ConformanceReport report = routeIndex.check({ { trackPositions[pointNum], "", timeAt(0, 0) } });
+        const metres expected = bruteForceCrossTrackDistance(planeTrack[pointNum], plane);
+        BOOST_CHECK_CLOSE(report.maxCrossTrackDistance + 1, expected + 1, percentageTolerance);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+///////////////////////////////////////////////////////////////////////////////